@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <chrono>
+#include <sys/stat.h>
+
+#define OPEN_FILES_MAX		128		// Maximum number of cached open file descriptors
+#define OPEN_FILES_VALID	5000	// Milliseconds before a cached descriptor is checked against its path again
+
+/**
+ * Bounded cache of open read-only file descriptors keyed by absolute path, along
+ * with the stat information of the opened file. Hot files can then be checked and
+ * read without open(), fstat(), and close() on every request.
+ *
+ * Entries are revalidated with stat() on the path every OPEN_FILES_VALID ms. If the
+ * path no longer leads to the same unchanged file, the descriptor is replaced, which
+ * also lets the page cache notice that its copy of the file is stale.
+ *
+ * NOTE: Not thread safe, only to be used from the server loop, except readUncached()
+ */
+class OpenFiles {
+
+public:
+	static int			acquire(std::string const &path, struct stat *info = nullptr);
+	static std::string	read(std::string const &path, struct stat *info = nullptr);
+	static std::string	readUncached(std::string const &path, struct stat *info);
+	static bool			sameFile(struct stat const &a, struct stat const &b);
+	static void			forget(std::string const &path);
+	static void			clear();
+
+private:
+	using timePoint = std::chrono::steady_clock::time_point;
+
+	struct OpenFile {
+		int			fd;
+		struct stat	info;
+		timePoint	validated;
+	};
+
+	using FileList = std::list<std::pair<std::string, OpenFile>>;
+
+	static int			open(std::string const &path, OpenFile &file);
+	static std::string	readAll(int fd, struct stat const &info, std::string const &path);
+
+	static FileList											files;		// Least recently used first
+	static std::unordered_map<std::string, FileList::iterator>	fileMap;
+};
@@ -1,11 +1,31 @@
 #pragma once
 
+#include "Parser.hpp"
+#include "OpenFiles.hpp"
 #include <string>
 #include <cstddef>
 #include <unordered_map>
 #include <list>
+#include <vector>
+#include <array>
+#include <deque>
+#include <future>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
 
-#define CACHE_SIZE_MAX	4194304	// 4 MiB
+#define CACHE_SIZE_MAX	4194304			// 4 MiB
+#define WARMUP_BUDGET	CACHE_SIZE_MAX	// Maximum amount of bytes preloaded by the startup warm-up
+#define WARMUP_THREADS	8				// Maximum number of files read concurrently during warm-up
+
+// Activator for the frequency based cache admission filter, set to 0 to admit every miss
+#define CACHE_ADMISSION_FILTER	1
+
+#define SKETCH_DEPTH	4						// Number of hashed counter rows in the frequency sketch
+#define SKETCH_WIDTH	4096					// Number of counters per row, power of two
+#define SKETCH_RESET	(SKETCH_WIDTH * 10)		// Recorded accesses before all counters are halved
 
 class Pages {
 
@@ -13,13 +33,63 @@ public:
 	static bool					isCached(std::string const &key);
 	static std::string const	&getPageContent(std::string const &key);
 	static void					clearCache();
+	static void					evict(std::string const &key);
 	static void					loadDefaults();
+	static void					warmUp(std::vector<Config> const &configs);
+	static void					completeLoads();
+	static void					logStats();
 
 private:
-	static std::unordered_map<std::string, std::string>			defaultPages;
-	static std::list<std::pair<std::string, std::string>>		cacheQueue;
-	static std::unordered_map<std::string, std::string const *>	cacheMap;
-	static std::string											bigFileName;
-	static std::string											bigFile;
-	static size_t												cacheSize;
+	/**
+	 * Page content along with the stat information of the file it was read from, to
+	 * notice when the file on disk has changed.
+	 */
+	struct CachedPage {
+		std::string	content;
+		struct stat	info;
+	};
+
+	using CacheList	= std::list<std::pair<std::string, CachedPage>>;
+	using Sketch	= std::array<std::array<uint8_t, SKETCH_WIDTH>, SKETCH_DEPTH>;
+
+	static std::string const	&addToCache(std::string const &key, CachedPage &&page);
+	static std::string const	&finishLoad(std::string const &key);
+	static void					warmUpWorker();
+	static bool					admit(std::string const &key, size_t pageSize);
+	static void					recordAccess(std::string const &key);
+	static uint8_t				estimateFrequency(std::string const &key);
+
+	static std::unordered_map<std::string, std::string>				defaultPages;
+	static CacheList												cacheQueue;	// Least recently used page first
+	static std::unordered_map<std::string, CacheList::iterator>		cacheMap;
+	static std::string												bigFileName;	// Last page that wasn't cached
+	static CachedPage												bigFile;
+	static size_t													cacheSize;
+
+	/**
+	 * Background read of a single page. Whoever claims the load first reads the file,
+	 * a worker thread or a request that can't wait for the worker to get to it.
+	 */
+	struct PageLoad {
+		std::string					key;
+		std::promise<CachedPage>	promise;
+		std::future<CachedPage>		result;
+		std::atomic<bool>			claimed = false;
+	};
+
+	static std::unordered_map<std::string, std::shared_ptr<PageLoad>>	loads;	// Unfinished page reads
+
+	static std::deque<std::shared_ptr<PageLoad>>			warmUpQueue;	// Guarded by warmUpMutex
+	static std::mutex										warmUpMutex;
+	static std::vector<std::future<void>>					warmUpWorkers;
+	static std::chrono::steady_clock::time_point			warmUpStart;
+	static bool												warmUpRunning;
+	static size_t											warmUpFiles;
+	static size_t											warmUpBytes;
+
+	static Sketch	sketch;			// Count-min sketch of recent page access frequencies
+	static size_t	sketchSamples;
+	static size_t	hits;
+	static size_t	misses;
+	static size_t	rejections;
 };
@@ -45,6 +45,7 @@ struct Config {
 
 	bool	directoryListing	= false;
 	bool	autoindex			= false;
+	bool	cacheWarmUp			= false;	// Preload status pages and route targets into the cache at startup
 };
 
 class Parser {
@@ -4,6 +4,7 @@
 #include <unordered_map>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <optional>
 #include <chrono>
 #include <memory>
@@ -106,6 +107,8 @@ private:
 	timePoint						_recvStart;
 	timePoint						_sendStart;
 	size_t							_headerSize;
+	size_t							_parsePos;	// Start of the first unparsed line in _buffer
+	size_t							_scanPos;	// Offset where an unfinished delimiter search resumes
 	std::optional<size_t>			_contentLen;
 	stringMap						_headers;
 	struct RequestLine				_request;
@@ -115,18 +118,19 @@ private:
 	std::optional<std::string>		_boundary;
 	std::optional<std::string>		_uploadDir;
 
+	size_t	findInBuffer(std::string_view delim, size_t from);
 	void	parseRequest();
-	void	parseRequestLine(std::string &req);
-	void	parseHeaders(std::string &str);
+	void	parseRequestLine(std::string_view req);
+	void	parseHeaders();
 
 	void	parseChunked();
 	void	printData() const;
 	void	printStatus() const;
 
 	bool	validateHeaders();
-	bool	areValidChars(std::string &target);
-	bool	validateAndAssignTarget(std::string &target);
-	bool	validateAndAssignHttp(std::string &httpVersion);
+	bool	areValidChars(std::string_view target);
+	bool	validateAndAssignTarget(std::string_view target);
+	bool	validateAndAssignHttp(std::string_view httpVersion);
 	bool	isUniqueHeader(std::string const &key);
 	bool	initialSaveToDisk(MultipartPart const &part);
 	bool	saveToDisk(MultipartPart const &part);
@@ -4,6 +4,8 @@
 #include "Request.hpp"
 #include "Parser.hpp"
 
+#define LISTING_CACHE_MAX	64	// Maximum number of cached directory listings
+
 class Request;
 
 enum ResponseCode : int {
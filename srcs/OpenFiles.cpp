@@ -0,0 +1,196 @@
+#include "OpenFiles.hpp"
+#include "Log.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+OpenFiles::FileList											OpenFiles::files;
+std::unordered_map<std::string, OpenFiles::FileList::iterator>	OpenFiles::fileMap;
+
+/**
+ * @return	true if both stat results describe the same, unmodified file
+ */
+bool	OpenFiles::sameFile(struct stat const &a, struct stat const &b)
+{
+	return a.st_dev == b.st_dev
+		&& a.st_ino == b.st_ino
+		&& a.st_size == b.st_size
+		&& a.st_mtim.tv_sec == b.st_mtim.tv_sec
+		&& a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+/**
+ * Opens path read-only and fills in file, only regular files are accepted.
+ *
+ * @return	Opened file descriptor, -1 on failure
+ */
+int	OpenFiles::open(std::string const &path, OpenFile &file)
+{
+	int	fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &file.info) < 0 || !S_ISREG(file.info.st_mode)) {
+		::close(fd);
+		return -1;
+	}
+	file.fd = fd;
+	file.validated = std::chrono::steady_clock::now();
+
+	return fd;
+}
+
+/**
+ * Looks up a cached descriptor for path, opening the file if needed. A cached entry
+ * older than OPEN_FILES_VALID is checked against the path with stat(), and if the
+ * file was modified or replaced, it is reopened.
+ *
+ * @param path	Absolute path of the file
+ * @param info	Optional output for the stat information of the file
+ *
+ * @return	Read-only file descriptor owned by the cache, -1 if path isn't a readable
+ *			regular file
+ */
+int	OpenFiles::acquire(std::string const &path, struct stat *info)
+{
+	auto const	now	= std::chrono::steady_clock::now();
+	auto		it	= fileMap.find(path);
+
+	if (it != fileMap.end()) {
+		OpenFile	&file	= it->second->second;
+		struct stat	current;
+
+		if (now - file.validated < std::chrono::milliseconds(OPEN_FILES_VALID)) {
+			files.splice(files.end(), files, it->second); // Mark as most recently used
+			if (info)
+				*info = file.info;
+			return file.fd;
+		}
+
+		if (stat(path.c_str(), &current) == 0 && sameFile(current, file.info)) {
+			file.validated = now;
+			files.splice(files.end(), files, it->second);
+			if (info)
+				*info = file.info;
+			return file.fd;
+		}
+
+		DEBUG_LOG("File '" + path + "' changed on disk, dropping cached descriptor");
+		forget(path);
+	}
+
+	OpenFile	file;
+
+	if (open(path, file) < 0)
+		return -1;
+
+	if (files.size() >= OPEN_FILES_MAX) {
+		::close(files.front().second.fd);
+		fileMap.erase(files.front().first);
+		files.pop_front();
+	}
+
+	files.emplace_back(path, file);
+	fileMap[path] = std::prev(files.end());
+	if (info)
+		*info = file.info;
+
+	return file.fd;
+}
+
+/**
+ * Loads a complete file into a std::string through its cached descriptor.
+ *
+ * NOTE: Throws a runtime error if file can't be opened or read, like getFileAsString
+ *
+ * @param info	Optional output for the stat information of the file that was read
+ *
+ * @return	String object containing the file's contents
+ */
+std::string	OpenFiles::read(std::string const &path, struct stat *info)
+{
+	struct stat	fileInfo;
+	int			fd = acquire(path, &fileInfo);
+
+	if (fd < 0)
+		throw std::runtime_error(ERROR_LOG("Couldn't open '" + path + "': " + strerror(errno)));
+	if (info)
+		*info = fileInfo;
+
+	return readAll(fd, fileInfo, path);
+}
+
+/**
+ * Thread safe variant of read() that opens and closes the file itself, leaving the
+ * descriptor cache untouched.
+ *
+ * NOTE: Throws a runtime error if file can't be opened or read
+ */
+std::string	OpenFiles::readUncached(std::string const &path, struct stat *info)
+{
+	OpenFile	file;
+
+	if (open(path, file) < 0)
+		throw std::runtime_error(ERROR_LOG("Couldn't open '" + path + "': " + strerror(errno)));
+
+	try {
+		std::string	content = readAll(file.fd, file.info, path);
+
+		::close(file.fd);
+		*info = file.info;
+
+		return content;
+	} catch (std::exception const &e) {
+		::close(file.fd);
+		throw;
+	}
+}
+
+/**
+ * Reads the whole file behind fd with pread(), leaving the file offset untouched so
+ * that the descriptor can be shared.
+ */
+std::string	OpenFiles::readAll(int fd, struct stat const &info, std::string const &path)
+{
+	std::string	content(static_cast<size_t>(info.st_size), '\0');
+	size_t		offset = 0;
+
+	while (offset < content.size()) {
+		ssize_t	bytesRead = pread(fd, content.data() + offset, content.size() - offset, offset);
+
+		if (bytesRead < 0 && errno == EINTR)
+			continue;
+		if (bytesRead < 0)
+			throw std::runtime_error(ERROR_LOG("Couldn't read '" + path + "': " + strerror(errno)));
+		if (bytesRead == 0)
+			break;
+		offset += bytesRead;
+	}
+	content.resize(offset);
+
+	return content;
+}
+
+/**
+ * Closes the cached descriptor of path, if any, for files that are modified,
+ * replaced, or deleted.
+ */
+void	OpenFiles::forget(std::string const &path)
+{
+	auto	it = fileMap.find(path);
+
+	if (it == fileMap.end())
+		return;
+	::close(it->second->second.fd);
+	files.erase(it->second);
+	fileMap.erase(it);
+}
+
+void	OpenFiles::clear()
+{
+	for (auto const &[path, file] : files)
+		::close(file.fd);
+	files.clear();
+	fileMap.clear();
+}
@@ -1,13 +1,30 @@
 #include "Pages.hpp"
 #include "Utils.hpp"
 #include "Log.hpp"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <future>
 
-std::unordered_map<std::string, std::string>			Pages::defaultPages;
-std::list<std::pair<std::string, std::string>>			Pages::cacheQueue;
-std::unordered_map<std::string, std::string const *>	Pages::cacheMap;
-std::string												Pages::bigFileName;
-std::string												Pages::bigFile;
-size_t													Pages::cacheSize = 0;
+std::unordered_map<std::string, std::string>				Pages::defaultPages;
+Pages::CacheList											Pages::cacheQueue;
+std::unordered_map<std::string, Pages::CacheList::iterator>	Pages::cacheMap;
+std::string													Pages::bigFileName;
+Pages::CachedPage											Pages::bigFile;
+size_t														Pages::cacheSize = 0;
+std::unordered_map<std::string, std::shared_ptr<Pages::PageLoad>>	Pages::loads;
+std::deque<std::shared_ptr<Pages::PageLoad>>				Pages::warmUpQueue;
+std::mutex													Pages::warmUpMutex;
+std::vector<std::future<void>>								Pages::warmUpWorkers;
+std::chrono::steady_clock::time_point						Pages::warmUpStart;
+bool														Pages::warmUpRunning = false;
+size_t														Pages::warmUpFiles = 0;
+size_t														Pages::warmUpBytes = 0;
+Pages::Sketch												Pages::sketch = {};
+size_t														Pages::sketchSamples = 0;
+size_t														Pages::hits = 0;
+size_t														Pages::misses = 0;
+size_t														Pages::rejections = 0;
 
 constexpr static char const * const	DEFAULT200	= \
 R"(<!DOCTYPE html>
@@ -206,33 +223,368 @@ std::string const	&Pages::getPageContent(std::string const &key)
 
 	if (defaultPages.find(key) != defaultPages.end())
 		return defaultPages.at(key);
-	if (cacheMap.find(key) != cacheMap.end())
-		return *cacheMap.at(key);
-	if (key == bigFileName)
-		return bigFile;
 
-	std::string	page = getFileAsString(key, "/"); // Force absolute filepath for unique identifiers for resources
+	recordAccess(key);
+
+	struct stat	info;
+	bool const	onDisk	= OpenFiles::acquire(key, &info) >= 0;
+	auto		it		= cacheMap.find(key);
+
+	// A page whose file has since been modified or replaced is stale
+	if (onDisk && it != cacheMap.end() && !OpenFiles::sameFile(info, it->second->second.info)) {
+		DEBUG_LOG("Cached page " + key + " is stale");
+		evict(key);
+		it = cacheMap.end();
+	}
+	if (it != cacheMap.end()) {
+		++hits;
+		cacheQueue.splice(cacheQueue.end(), cacheQueue, it->second); // Mark as most recently used
+		return it->second->second.content;
+	}
+	if (key == bigFileName && (!onDisk || OpenFiles::sameFile(info, bigFile.info))) {
+		++hits;
+		return bigFile.content;
+	}
+	++misses;
+
+	auto	load = loads.find(key);
+
+	// Join a read that is already in flight instead of reading the file again
+	if (load != loads.end()) {
+		if (load->second->claimed.exchange(true))
+			return finishLoad(key);
+		loads.erase(load);
+	}
+
+	CachedPage	page;
+
+	page.content = OpenFiles::read(key, &page.info);
+
+	return addToCache(key, std::move(page));
+}
+
+/**
+ * Waits for the claimed read of key to finish and caches the result.
+ *
+ * NOTE: Rethrows the exception of a failed read, like getFileAsString
+ *
+ * @return	String containing page content
+ */
+std::string const	&Pages::finishLoad(std::string const &key)
+{
+	auto	load = std::move(loads.at(key));
+
+	loads.erase(key);
+
+	CachedPage	page = load->result.get();
+
+	// Loads are only created by the warm-up
+	warmUpBytes += page.content.length();
+	++warmUpFiles;
+
+	return addToCache(key, std::move(page));
+}
+
+/**
+ * Warm-up thread body, reads queued pages until the queue runs out. Pages that a
+ * request has already claimed are skipped.
+ */
+void	Pages::warmUpWorker()
+{
+	while (true) {
+		std::shared_ptr<PageLoad>	load;
+
+		{
+			std::lock_guard<std::mutex>	lock(warmUpMutex);
+
+			if (warmUpQueue.empty())
+				return;
+			load = std::move(warmUpQueue.front());
+			warmUpQueue.pop_front();
+		}
 
-	if (page.length() > CACHE_SIZE_MAX) {
-		DEBUG_LOG("File '" + key + "' is too large for cache");
-		bigFile = page;
+		if (load->claimed.exchange(true))
+			continue;
+
+		try {
+			CachedPage	page;
+
+			page.content = OpenFiles::readUncached(load->key, &page.info);
+			load->promise.set_value(std::move(page));
+		} catch (...) {
+			load->promise.set_exception(std::current_exception());
+		}
+	}
+}
+
+/**
+ * Stores a loaded page in the cache, evicting the least recently used entries until
+ * it fits. Pages larger than the whole cache, and pages refused by the admission
+ * filter, are kept in the single uncached page slot instead.
+ *
+ * @return	String containing page content
+ */
+std::string const	&Pages::addToCache(std::string const &key, CachedPage &&page)
+{
+	size_t const	pageSize = page.content.length();
+
+	if (pageSize > CACHE_SIZE_MAX || !admit(key, pageSize)) {
+		DEBUG_LOG("File '" + key + "' not added to cache");
+		bigFile = std::move(page);
 		bigFileName = key;
-		return bigFile;
+		return bigFile.content;
 	}
 
-	while (cacheSize > 0 && cacheSize > CACHE_SIZE_MAX - page.length()) {
+	while (cacheSize > 0 && cacheSize > CACHE_SIZE_MAX - pageSize) {
 		DEBUG_LOG("Removing " + cacheQueue.front().first + " from cache to make space for " + key);
-		cacheSize -= cacheQueue.front().second.length();
+		cacheSize -= cacheQueue.front().second.content.length();
 		cacheMap.erase(cacheQueue.front().first);
 		cacheQueue.pop_front();
 	}
 
 	DEBUG_LOG("Adding " + key + " to cache");
-	cacheQueue.emplace_back(key, page);
-	cacheMap[key] = &cacheQueue.back().second;
-	cacheSize += page.length();
+	cacheSize += pageSize;
+	cacheQueue.emplace_back(key, std::move(page));
+	cacheMap[key] = std::prev(cacheQueue.end());
+
+	return cacheQueue.back().second.content;
+}
+
+/**
+ * Removes a page from the cache, for pages that are stale or deleted.
+ */
+void	Pages::evict(std::string const &key)
+{
+	auto	it = cacheMap.find(key);
+
+	if (key == bigFileName) {
+		bigFileName.clear();
+		bigFile = {};
+	}
+	if (it == cacheMap.end())
+		return;
+	cacheSize -= it->second->second.content.length();
+	cacheQueue.erase(it->second);
+	cacheMap.erase(it);
+}
+
+/**
+ * TinyLFU style admission: a page that fits into free space is always admitted,
+ * otherwise it has to have been requested more often recently than every page that
+ * would be evicted to make room for it. This keeps pages that are only requested
+ * once, such as those walked by a crawler, from pushing out frequently used ones.
+ *
+ * @return	true if the page should be cached, false if not
+ */
+bool	Pages::admit(std::string const &key, size_t pageSize)
+{
+	#if CACHE_ADMISSION_FILTER
+	if (cacheSize <= CACHE_SIZE_MAX - pageSize)
+		return true;
+
+	uint8_t const	candidateFrequency	= estimateFrequency(key);
+	size_t			freed				= CACHE_SIZE_MAX - cacheSize;
+
+	for (auto it = cacheQueue.begin(); it != cacheQueue.end() && freed < pageSize; ++it) {
+		if (estimateFrequency(it->first) >= candidateFrequency) {
+			DEBUG_LOG("Cache admission rejected for " + key);
+			++rejections;
+			return false;
+		}
+		freed += it->second.content.length();
+	}
+	#else
+	(void)key;
+	(void)pageSize;
+	#endif
+
+	return true;
+}
+
+/**
+ * Row specific counter index for a key, rows use differently mixed bits of one hash.
+ */
+static size_t	sketchIndex(size_t hash, size_t row)
+{
+	static constexpr size_t	seeds[] = {
+		0x9e3779b97f4a7c15ULL,
+		0xc2b2ae3d27d4eb4fULL,
+		0x165667b19e3779f9ULL,
+		0xd6e8feb86659fd93ULL
+	};
+
+	hash *= seeds[row % std::size(seeds)];
+	return (hash ^ (hash >> 32)) & (SKETCH_WIDTH - 1);
+}
+
+/**
+ * Increments the 4 bit counters of key in the frequency sketch. Once SKETCH_RESET
+ * accesses have been recorded, all counters are halved so that old popularity fades.
+ */
+void	Pages::recordAccess(std::string const &key)
+{
+	size_t const	hash = std::hash<std::string>{}(key);
+
+	for (size_t row = 0; row < SKETCH_DEPTH; ++row) {
+		uint8_t	&counter = sketch[row][sketchIndex(hash, row)];
+
+		if (counter < 15)
+			++counter;
+	}
+
+	if (++sketchSamples < SKETCH_RESET)
+		return;
+
+	for (auto &row : sketch)
+		for (auto &counter : row)
+			counter >>= 1;
+	sketchSamples /= 2;
+}
+
+/**
+ * @return	Estimated recent access count of key, the smallest of its counters
+ */
+uint8_t	Pages::estimateFrequency(std::string const &key)
+{
+	size_t const	hash		= std::hash<std::string>{}(key);
+	uint8_t			frequency	= 15;
+
+	for (size_t row = 0; row < SKETCH_DEPTH; ++row)
+		frequency = std::min(frequency, sketch[row][sketchIndex(hash, row)]);
+
+	return frequency;
+}
+
+/**
+ * Logs cache hit ratio and admission statistics, to compare cache behaviour with
+ * CACHE_ADMISSION_FILTER on and off.
+ */
+void	Pages::logStats()
+{
+	size_t const	lookups	= hits + misses;
+	size_t const	ratio	= lookups ? hits * 1000 / lookups : 0;
+
+	INFO_LOG("Page cache: " + std::to_string(hits) + " hits, " + std::to_string(misses)
+		+ " misses, hit ratio " + std::to_string(ratio / 10) + "." + std::to_string(ratio % 10)
+		+ "%, " + std::to_string(rejections) + " admissions rejected");
+}
+
+/**
+ * Preloads custom status pages and route targets of every config that has cache
+ * warm-up enabled. Status pages are queued first, then the files under each route
+ * target, until WARMUP_BUDGET bytes have been claimed. Files are read from disk by
+ * WARMUP_THREADS background threads, and added to the cache by completeLoads()
+ * while the server is already accepting requests.
+ */
+void	Pages::warmUp(std::vector<Config> const &configs)
+{
+	namespace fs = std::filesystem;
+
+	size_t	budget	= WARMUP_BUDGET;
+
+	// Claims budget for a single regular file, files that don't fit are skipped
+	auto	queueFile = [&](fs::directory_entry const &entry) {
+		std::error_code	ec;
+		std::string		key = getAbsPath(entry.path().string());
+
+		if (!entry.is_regular_file(ec) || loads.count(key) || isCached(key))
+			return;
+
+		size_t const	size = entry.file_size(ec);
+
+		if (ec || size > budget)
+			return;
+		budget -= size;
+
+		auto	load = std::make_shared<PageLoad>();
+
+		load->key = key;
+		load->result = load->promise.get_future();
+		loads[key] = load;
+		warmUpQueue.emplace_back(std::move(load));
+	};
+
+	if (std::none_of(configs.begin(), configs.end(), [](auto const &c) { return c.cacheWarmUp; }))
+		return;
+
+	warmUpStart = std::chrono::steady_clock::now();
+
+	for (auto const &conf : configs) {
+		if (!conf.cacheWarmUp)
+			continue;
+		for (auto const &[code, page] : conf.statusPages) {
+			std::error_code	ec;
+
+			queueFile(fs::directory_entry(page, ec));
+		}
+	}
+
+	for (auto const &conf : configs) {
+		if (!conf.cacheWarmUp || budget == 0)
+			continue;
+		for (auto const &[uri, route] : conf.routes) {
+			std::error_code	ec;
+
+			// Scripts are executed, not served, so there's no use in caching them
+			if (uri == "cgi-bin" || budget == 0)
+				continue;
+			if (!fs::is_directory(route.target, ec)) {
+				queueFile(fs::directory_entry(route.target, ec));
+				continue;
+			}
+			for (auto it = fs::recursive_directory_iterator(route.target,
+					fs::directory_options::skip_permission_denied, ec);
+				!ec && budget > 0 && it != fs::recursive_directory_iterator(); it.increment(ec))
+				queueFile(*it);
+		}
+	}
+
+	warmUpRunning = true;
+	for (size_t i = 0; i < WARMUP_THREADS && i < warmUpQueue.size(); ++i)
+		warmUpWorkers.emplace_back(std::async(std::launch::async, warmUpWorker));
+	completeLoads();
+}
+
+/**
+ * Caches the results of finished warm-up reads, and logs the duration and size of
+ * the warm-up once every queued page has been loaded. Called once per server loop
+ * round.
+ */
+void	Pages::completeLoads()
+{
+	if (!warmUpRunning)
+		return;
+
+	for (auto it = loads.begin(); it != loads.end();) {
+		auto const	&load = it->second;
+
+		if (!load->claimed || load->result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			++it;
+			continue;
+		}
+
+		std::string const	key = (it++)->first;
+
+		try {
+			finishLoad(key);
+		} catch (std::exception const &e) {
+			DEBUG_LOG("Skipping '" + key + "' in cache warm-up: " + e.what());
+		}
+	}
+
+	if (!loads.empty())
+		return;
+
+	for (auto &worker : warmUpWorkers)
+		worker.get();
+	warmUpWorkers.clear();
+	warmUpRunning = false;
+
+	auto const	elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - warmUpStart);
 
-	return *cacheMap.at(key);
+	INFO_LOG("Cache warm-up loaded " + std::to_string(warmUpFiles) + " files, "
+		+ std::to_string(warmUpBytes) + " bytes in " + std::to_string(elapsed.count()) + " ms");
 }
 
 void	Pages::clearCache()
@@ -240,4 +592,8 @@ void	Pages::clearCache()
 	cacheMap.clear();
 	cacheQueue.clear();
 	cacheSize = 0;
+	bigFileName.clear();
+	bigFile = {};
+	sketch = {};
+	sketchSamples = 0;
 }
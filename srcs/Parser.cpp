@@ -170,6 +170,7 @@ Config	Parser::convertToServerData(Token const &block)
 			"host",
 			"directory_listing",
 			"autoindex",
+			"cache_warm_up",
 			"client_max_body_size"
 		};
 
@@ -208,7 +209,7 @@ Config	Parser::convertToServerData(Token const &block)
 				continue;
 			}
 
-			if (key == "directory_listing" || key == "autoindex") {
+			if (key == "directory_listing" || key == "autoindex" || key == "cache_warm_up") {
 				if (tok.value != "true" && tok.value != "false")
 					throw ParserException(ERROR_LOG("\tInvalid value for '" + key + "': " + tok.value));
 
@@ -216,8 +217,10 @@ Config	Parser::convertToServerData(Token const &block)
 
 				if (key == "directory_listing")
 					config.directoryListing = (tok.value == "true");
-				else
+				else if (key == "autoindex")
 					config.autoindex = (tok.value == "true");
+				else
+					config.cacheWarmUp = (tok.value == "true");
 
 				continue;
 			}
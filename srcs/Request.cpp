@@ -2,7 +2,7 @@
 #include "Log.hpp"
 #include "Response.hpp"
 #include "Utils.hpp"
-#include <regex>
+#include <algorithm>
 #include <iostream>
 #include <unordered_set>
 #include <chrono>
@@ -23,7 +23,9 @@ Request::Request(int fd, int serverFd)
 		_chunked(false),
 		_completeHeaders(false),
 		_uploadFD(nullptr),
-		_headerSize(0)
+		_headerSize(0),
+		_parsePos(0),
+		_scanPos(0)
 {
 	_request.method = RequestMethod::Unknown;
 	_status = ClientStatus::WaitingForData;
@@ -35,20 +37,15 @@ Request::Request(int fd, int serverFd)
 }
 
 /**
- * Saves the current buffer filled by recv into the combined buffer of this client.
- * Checks whether the buffer so far includes "\r\n\r\n". If not, and the headers
- * section hasn't earlier been received completely (ending with "\r\n\r\n"), we
- * assume the request is partial. In that case, we go back to poll() to wait for
- * the rest of the response before parsing.
+ * Saves the current buffer filled by recv into the combined buffer of this client
+ * and continues parsing from where the previous call stopped. Complete lines of the
+ * request line and headers are consumed as soon as they arrive, a partial line is
+ * left in the buffer until the rest of it has been received.
  */
 void	Request::processRequest(std::string const &buf)
 {
 	_buffer += buf;
-
-	if (_buffer.find("\r\n\r\n") == std::string::npos && !_completeHeaders)
-		_status = ClientStatus::WaitingForData;
-	else
-		parseRequest();
+	parseRequest();
 }
 
 /**
@@ -64,6 +61,8 @@ void	Request::reset()
 	_request.query.reset();
 	_headers.clear();
 	_headerSize = 0;
+	_parsePos = 0;
+	_scanPos = 0;
 	_body.clear();
 	_contentLen.reset();
 	_chunked = false;
@@ -162,26 +161,70 @@ static std::string	extractFromLine(std::string &orig, std::string_view delim)
 }
 
 /**
- * Validates and parses request section by section.
+ * Searches the buffer for delim starting at offset from. A search that fails
+ * remembers how far it got, so the next search for the same delimiter, after more
+ * data has arrived, skips the bytes already scanned. Only the last bytes that could
+ * hold the beginning of a split delimiter are scanned again.
+ *
+ * NOTE: The scan position is reset on a match, and has to be reset whenever the
+ * start of the buffer is erased without a match.
+ *
+ * @return	Offset of delim in the buffer, std::string::npos if not found
+ */
+size_t	Request::findInBuffer(std::string_view delim, size_t from)
+{
+	size_t const	pos = _buffer.find(delim, std::max(from, _scanPos));
+
+	if (pos != std::string::npos)
+		_scanPos = 0;
+	else if (_buffer.size() >= delim.size())
+		_scanPos = std::max(from, _buffer.size() - delim.size() + 1);
+	return pos;
+}
+
+/**
+ * Validates and parses request section by section. The request line and headers
+ * are read in place from the buffer, _parsePos marking the start of the first line
+ * not yet parsed. The consumed head of the buffer is dropped only once, when the
+ * header section is complete.
  */
 void	Request::parseRequest()
 {
 	if (_request.method == RequestMethod::Unknown) {
-		std::string	reqLine = extractFromLine(_buffer, CRLF);
+		size_t const	lineEnd = findInBuffer(CRLF, _parsePos);
+
+		if (lineEnd == std::string::npos) {
+			if (_buffer.size() - _parsePos > REQLINE_MAX_SIZE) {
+				INFO_LOG("Bad request: request line too long, client fd " + std::to_string(_fd));
+				_status = ClientStatus::Invalid;
+				_buffer.clear();
+				_parsePos = 0;
+				_scanPos = 0;
+			} else
+				_status = ClientStatus::WaitingForData;
+			return;
+		}
 
-		parseRequestLine(reqLine);
+		parseRequestLine(std::string_view(_buffer).substr(_parsePos, lineEnd - _parsePos));
+		_parsePos = lineEnd + 2;
 		if (_status == ClientStatus::Invalid) {
 			_buffer.clear();
+			_parsePos = 0;
+			_scanPos = 0;
 			return;
 		}
 	}
 
 	if (!_completeHeaders)
-		parseHeaders(_buffer);
+		parseHeaders();
 	if (_status == ClientStatus::Invalid || _status == ClientStatus::Error) {
 		_buffer.clear();
+		_parsePos = 0;
+		_scanPos = 0;
 		return;
 	}
+	if (!_completeHeaders)
+		return;
 
 	if (_contentLen.has_value() && _contentLen.value() > CLIENT_MAX_BODY_SIZE) {
 		// If Content-length header value exceeds the limit, we won't parse further
@@ -247,17 +290,22 @@ void	Request::parseRequest()
  * Splits the request line into tokens, recognises method, and validates target path
  * and HTTP version.
  */
-void	Request::parseRequestLine(std::string &req)
+void	Request::parseRequestLine(std::string_view req)
 {
-	std::string					method, target, httpVersion;
-	std::vector<std::string>	implementedMethods = { "GET", "POST", "DELETE" };
-	std::vector<std::string>	existingMethods = {	"GET", "POST", "DELETE", "PUT", "PATCH",
-													"HEAD", "OPTIONS", "TRACE", "CONNECT" };
-	size_t						i = 0;
-
-	method		= extractFromLine(req, " ");
-	target 		= extractFromLine(req, " ");
-	httpVersion	= req;
+	static constexpr std::string_view	implementedMethods[] = { "GET", "POST", "DELETE" };
+	static constexpr std::string_view	existingMethods[] = { "GET", "POST", "DELETE", "PUT",
+											"PATCH", "HEAD", "OPTIONS", "TRACE", "CONNECT" };
+	size_t const						methodEnd = req.find(' ');
+	size_t const						targetEnd = methodEnd == std::string_view::npos
+											? methodEnd : req.find(' ', methodEnd + 1);
+	std::string_view					method, target, httpVersion;
+	size_t								i = 0;
+
+	if (targetEnd != std::string_view::npos) {
+		method		= req.substr(0, methodEnd);
+		target		= req.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+		httpVersion	= req.substr(targetEnd + 1);
+	}
 
 	if (method.empty() || target.empty() || httpVersion.empty()) {
 		INFO_LOG("Bad request: invalid request line, client fd " + std::to_string(_fd));
@@ -266,7 +314,7 @@ void	Request::parseRequestLine(std::string &req)
 	}
 	_request.methodString = method;
 
-	for (i = 0; i < implementedMethods.size(); i++)
+	for (i = 0; i < std::size(implementedMethods); i++)
 		if (implementedMethods[i] == method)
 			break;
 
@@ -277,9 +325,9 @@ void	Request::parseRequestLine(std::string &req)
 		default:
 			_status = ClientStatus::Invalid;
 
-			auto	it = std::find(existingMethods.begin(), existingMethods.end(), _request.methodString);
+			auto	it = std::find(std::begin(existingMethods), std::end(existingMethods), method);
 
-			if (it == existingMethods.end()) {
+			if (it == std::end(existingMethods)) {
 				INFO_LOG("Bad request: invalid method format, client fd " + std::to_string(_fd));
 				_responseCodeBypass = BadRequest;
 			} else {
@@ -289,82 +337,70 @@ void	Request::parseRequestLine(std::string &req)
 			return;
 	}
 
-	if (_request.methodString.length() + target.length() + httpVersion.length() > REQLINE_MAX_SIZE
-		|| !validateAndAssignTarget(target) || !validateAndAssignHttp(httpVersion)) {
+	if (req.size() > REQLINE_MAX_SIZE || !validateAndAssignTarget(target)
+		|| !validateAndAssignHttp(httpVersion)) {
 		INFO_LOG("Bad request: invalid request line, client fd " + std::to_string(_fd));
 		_status = ClientStatus::Invalid;
 	}
 }
 
 /**
- * Parses and stores each header as key and value to an unordered map until the end
- * of headers marked with "\r\n\r\n".
+ * Parses and stores each complete header line as key and value to an unordered map,
+ * starting from _parsePos, until the empty line ending the header section. Lines are
+ * viewed in place in the buffer, and only the stored keys and values are copied. If
+ * the section is still incomplete, parsing resumes from the first partial line when
+ * more data arrives.
  */
-void	Request::parseHeaders(std::string &str)
+void	Request::parseHeaders()
 {
-	// HTTP/1.0 request is valid without any headers; only trailing CRLF left here
-	if (_request.httpVersion == "HTTP/1.0" && str == "\r\n") {
-		_completeHeaders = true;
-		_status = ClientStatus::CompleteReq;
-		_buffer.clear();
-		return;
-	}
+	std::string_view const	buffer(_buffer);
 
-	std::string	line;
-	size_t		headEnd = str.find("\r\n\r\n");
+	while (!_completeHeaders) {
+		size_t const	lineEnd = findInBuffer(CRLF, _parsePos);
 
-	if (headEnd == std::string::npos)
-		headEnd = str.size();
+		if (lineEnd == std::string::npos)
+			break;
 
-	_headerSize = headEnd;
-	if (_headerSize > HEADERS_MAX_SIZE) {
-		INFO_LOG("Bad request: header section too large, client fd " + std::to_string(_fd));
-		_status = ClientStatus::Invalid;
-		return;
-	}
+		std::string_view const	line = buffer.substr(_parsePos, lineEnd - _parsePos);
 
-	while (!str.empty()) {
-		if (str.substr(0, 2) == CRLF) {
-			str.erase(0, 2);
+		_parsePos = lineEnd + 2;
+		if (line.empty()) {
 			_completeHeaders = true;
 			break;
 		}
 
-		line = extractFromLine(str, CRLF);
+		_headerSize += line.size() + 2;
+		if (_headerSize > HEADERS_MAX_SIZE) {
+			INFO_LOG("Bad request: header section too large, client fd " + std::to_string(_fd));
+			_status = ClientStatus::Invalid;
+			return;
+		}
 
-		size_t const	colonPos = line.find(":");
+		size_t const	colonPos = line.find(':');
 
 		// If a header line doesn't include ':', it's a suspicious request
-		if (colonPos == std::string::npos) {
+		if (colonPos == std::string_view::npos) {
 			ERROR_LOG("Bad request: invalid header section format, client fd " + std::to_string(_fd));
 			_status = ClientStatus::Error;
 			_keepAlive = false;
 			return;
 		}
 
-		std::string	key = line.substr(0, colonPos);
+		std::string	key(line.substr(0, colonPos));
 
 		for (size_t i = 0; i < key.size(); i++)
 			key[i] = std::tolower(static_cast<unsigned char>(key[i]));
 
-		std::string	value		= line.substr(colonPos + 1, line.size() - (colonPos + 1));
-		auto		realStart	= value.find_first_not_of(' ');
+		std::string_view	value		= line.substr(colonPos + 1);
+		auto				realStart	= value.find_first_not_of(' ');
 
 		// No header value after key, ':', and space(s) means invalid request
-		if (realStart == std::string::npos) {
+		if (realStart == std::string_view::npos) {
 			INFO_LOG("Bad request: invalid header section, client fd " + std::to_string(_fd));
 			_status = ClientStatus::Invalid;
 			return;
 		}
-		if (realStart != 0)
-			value.erase(0, realStart);
-
-		/* For Content-Type, value will not be turned to lowercase to keep possible
-		boundary= value literal */
-		if (key != "content-type") {
-			for (size_t i = 0; i < value.size(); i++)
-				value[i] = std::tolower(static_cast<unsigned char>(value[i]));
-		}
+		value.remove_prefix(realStart);
 
 		// Headers that allow only one value will be checked for validity
 		if (_headers.find(key) != _headers.end() && isUniqueHeader(key)) {
@@ -374,38 +410,50 @@ void	Request::parseHeaders(std::string &str)
 			return;
 		}
 
-		std::istringstream	values(value);
-		std::string			oneValue;
-
 		/* For Content-Type, possible multiple values on same line are separated
-		with a semicolon, for other headers, with a comma */
-		if (key == "content-type") {
-			if (value.find(";") == std::string::npos) {
-				_headers[key].emplace_back(value);
-				continue;
-			}
-			while (getline(values, oneValue, ';')) {
-				if (!oneValue.empty() && oneValue[0] == ' ')
-					oneValue.erase(0, 1);
-				_headers[key].emplace_back(oneValue);
-			}
-		} else {
-			if (value.find(",") == std::string::npos) {
-				_headers[key].emplace_back(value);
-				continue;
-			}
-			while (getline(values, oneValue, ',')) {
-				if (!oneValue.empty() && oneValue[0] == ' ')
-					oneValue.erase(0, 1);
-				_headers[key].emplace_back(oneValue);
+		with a semicolon, and the value will not be turned to lowercase to keep
+		possible boundary= value literal. For other headers, values are separated
+		with a comma. */
+		bool const					contentType	= key == "content-type";
+		char const					delim		= contentType ? ';' : ',';
+		std::vector<std::string>	&values		= _headers[key];
+
+		while (!value.empty()) {
+			size_t const		delimPos	= value.find(delim);
+			std::string_view	oneValue	= value.substr(0, delimPos);
+
+			if (!oneValue.empty() && oneValue[0] == ' ')
+				oneValue.remove_prefix(1);
+
+			std::string	&stored = values.emplace_back(oneValue);
+
+			if (!contentType) {
+				for (size_t i = 0; i < stored.size(); i++)
+					stored[i] = std::tolower(static_cast<unsigned char>(stored[i]));
 			}
+			if (delimPos == std::string_view::npos)
+				break;
+			value.remove_prefix(delimPos + 1);
 		}
 	}
 
-	if (!_completeHeaders)
-		_status = ClientStatus::WaitingForData;
+	if (!_completeHeaders) {
+		// Partial line left in the buffer counts towards the header section size
+		if (_headerSize + _buffer.size() - _parsePos > HEADERS_MAX_SIZE) {
+			INFO_LOG("Bad request: header section too large, client fd " + std::to_string(_fd));
+			_status = ClientStatus::Invalid;
+		} else
+			_status = ClientStatus::WaitingForData;
+		return;
+	}
+
+	// Drop the parsed head of the request, leaving only the body in the buffer
+	_buffer.erase(0, _parsePos);
+	_parsePos = 0;
+	_scanPos = 0;
 
-	if (_headers.empty() || !validateHeaders()) {
+	// HTTP/1.0 request is valid without any headers
+	if ((_headers.empty() && _request.httpVersion != "HTTP/1.0") || !validateHeaders()) {
 		INFO_LOG("Bad request: invalid header section, client fd " + std::to_string(_fd));
 		_status = ClientStatus::Invalid;
 	}
@@ -422,7 +470,7 @@ void	Request::parseChunked()
 	size_t	len;
 
 	auto	crlfPos = _buffer.find(CRLF);
-	auto	headerEnd = _buffer.find("0\r\n\r\n");
+	auto	headerEnd = findInBuffer("0\r\n\r\n", 0);
 
 	if (headerEnd == std::string::npos) {
 		_status = ClientStatus::WaitingForData;
@@ -620,7 +668,7 @@ bool	Request::isUniqueHeader(std::string const &key)
 /**
  * Validates target path characters.
  */
-bool	Request::areValidChars(std::string &s)
+bool	Request::areValidChars(std::string_view s)
 {
 	for (size_t i = 0; i < s.size(); i++) {
 		if (s[i] < 32 || s[i] >= 127 || s[i] == '<' || s[i] == '>'
@@ -638,7 +686,7 @@ bool	Request::areValidChars(std::string &s)
  * In case the URI includes '?', we use it as a separator to get the query.
  * Later in CGI handler, the possible query will be split with '&'s.
  */
-bool	Request::validateAndAssignTarget(std::string &target)
+bool	Request::validateAndAssignTarget(std::string_view target)
 {
 	if (target.size() == 1 && target != "/")
 		return false;
@@ -646,16 +694,16 @@ bool	Request::validateAndAssignTarget(std::string &target)
 		return false;
 
 	size_t	protocolEnd = target.find("://");
-	if (protocolEnd != std::string::npos) {
-		std::string protocol = target.substr(0, protocolEnd);
+	if (protocolEnd != std::string_view::npos) {
+		std::string_view	protocol = target.substr(0, protocolEnd);
 		if (protocol != "http" && protocol != "https")
 			return false;
 	}
 
 	size_t	queryStart = target.find('?');
-	if (queryStart != std::string::npos) {
+	if (queryStart != std::string_view::npos) {
 		_request.target = target.substr(0, queryStart);
-		_request.query = target.substr(queryStart + 1);
+		_request.query.emplace(target.substr(queryStart + 1));
 	} else
 		_request.target = target;
 
@@ -665,9 +713,9 @@ bool	Request::validateAndAssignTarget(std::string &target)
 /**
  * Only accepts HTTP/1.0 and HTTP/1.1 as valid versions on the request line.
  */
-bool	Request::validateAndAssignHttp(std::string &httpVersion)
+bool	Request::validateAndAssignHttp(std::string_view httpVersion)
 {
-	if (!std::regex_match(httpVersion, std::regex("HTTP/1.([01])")))
+	if (httpVersion != "HTTP/1.0" && httpVersion != "HTTP/1.1")
 		return false;
 	_request.httpVersion = httpVersion;
 	return true;
@@ -923,7 +971,7 @@ void	Request::handleFileUpload()
 		if (_buffer.compare(headersStart, 2, "\r\n") == 0)
 			headersStart += 2;
 
-		size_t const	partEnd = _buffer.find(partDelimiter, headersStart);
+		size_t const	partEnd = findInBuffer(partDelimiter, headersStart);
 
 		// Need to find a second delimiter for data processing
 		if (partEnd == std::string::npos) {
@@ -967,7 +1015,7 @@ void	Request::handleFileUpload()
 		}
 
 		// Remove already saved part of buffer, no need to hold it in memory
-		_buffer = _buffer.substr(partEnd);
+		_buffer.erase(0, partEnd);
 	}
 }
 
@@ -4,12 +4,14 @@
 #include "CgiHandler.hpp"
 #include "Log.hpp"
 #include "Pages.hpp"
+#include "OpenFiles.hpp"
 #include <algorithm>
 #include <cerrno>
 #include <cstring>
 #include <sstream>
 #include <string>
 #include <vector>
+#include <unordered_map>
 #include <iostream>
 #include <filesystem>
 #include <sys/socket.h>
@@ -22,8 +24,18 @@ static std::string const	&getResponsePageContent(std::string const &key, Config
 static std::string			getContentType(std::string sv);
 static void					listify(std::vector<std::string> const &vec,
 									std::string_view target,
-									std::string_view route,
-									std::stringstream &stream);
+									std::string &html);
+
+/**
+ * Generated directory listings, keyed by listed directory and request target. An
+ * entry stays valid as long as the modification time of the directory is unchanged.
+ */
+struct DirectoryListing {
+	std::filesystem::file_time_type	mtime;
+	std::string						html;
+};
+
+static std::unordered_map<std::string, DirectoryListing>	listingCache;
 
 /**
  * Main functionality for response forming. Categorizes and links information from the source request
@@ -128,7 +140,8 @@ Response::Response(Request const &req, Config const &conf) : _req(req), _conf(co
 
 	/* --- Directory targets --- */
 
-	if (_req.getRequestMethod() == RequestMethod::Get && std::filesystem::is_directory(_target))
+	if (_req.getRequestMethod() == RequestMethod::Get && OpenFiles::acquire(getAbsPath(_target)) < 0
+		&& std::filesystem::is_directory(_target))
 		handleDirectoryTarget();
 
 	if (_statusCode == Forbidden && _req.getRequestMethod() == RequestMethod::Get) {
@@ -407,6 +420,8 @@ void	Response::handleDelete()
 		if (!ret)
 			throw std::runtime_error("");
 
+		OpenFiles::forget(getAbsPath(_target));
+
 		DEBUG_LOG("Resource '" + _target + "' deleted");
 		_statusCode = NoContent;
 	} catch (std::exception &e) {
@@ -439,30 +454,34 @@ void	Response::handleDirectoryTarget()
 }
 
 /**
+ * Listings are cached per directory and target, and regenerated only when the
+ * modification time of the directory changes, so that repeated hits on a large
+ * directory don't rescan it.
+ *
  * @return	String containing the HTML page with links to the contents of the directory
  */
 std::string	Response::getDirectoryList(std::string_view target, std::string_view route)
 {
+	std::string const	key = std::string(route) + "\n" + std::string(target);
+	std::error_code		ec;
+	auto const			mtime = std::filesystem::last_write_time(route, ec);
+	auto				it = listingCache.find(key);
+
+	if (!ec && it != listingCache.end() && it->second.mtime == mtime) {
+		DEBUG_LOG("Directory list for '" + std::string(route) + "' found in cache");
+		return it->second.html;
+	}
+
 	std::vector<std::string>	files;
 	std::vector<std::string>	directories;
-	std::stringstream			stream;
-
-	stream << "<!DOCTYPE html><html><head></head><body>\n";
-
-	stream << "<h1>" << target << "</h1>";
+	std::string					html;
 
 	try {
 		for (auto const &e : std::filesystem::directory_iterator(route)) {
-
-			std::string	name = e.path().string();
-
-			if (e.is_regular_file()) {
-				auto	pos = std::upper_bound(files.begin(), files.end(), name);
-				files.insert(pos, name);
-			} else if (e.is_directory()) {
-				auto	pos = std::upper_bound(directories.begin(), directories.end(), name);
-				directories.insert(pos, name);
-			}
+			if (e.is_regular_file())
+				files.emplace_back(e.path().filename().string());
+			else if (e.is_directory())
+				directories.emplace_back(e.path().filename().string());
 		}
 	} catch (std::exception const &e) {
 		std::stringstream	errorMsg;
@@ -477,19 +496,35 @@ std::string	Response::getDirectoryList(std::string_view target, std::string_view
 		return "";
 	}
 
+	std::sort(files.begin(), files.end());
+	std::sort(directories.begin(), directories.end());
+
+	html.reserve(128 + (files.size() + directories.size()) * (2 * target.length() + 64));
+	html += "<!DOCTYPE html><html><head></head><body>\n";
+	html += "<h1>";
+	html += target;
+	html += "</h1>";
+
 	if (!directories.empty()) {
-		stream << "<h2>Directories</h2>\n";
-		listify(directories, target, route, stream);
+		html += "<h2>Directories</h2>\n";
+		listify(directories, target, html);
 	}
 
 	if (!files.empty()) {
-		stream << "\n<h2>Files</h2>\n";
-		listify(files, target, route, stream);
+		html += "\n<h2>Files</h2>\n";
+		listify(files, target, html);
 	}
 
-	stream << "</body></html>\n";
+	html += "</body></html>\n";
+
+	if (ec)
+		return html;
+
+	if (it == listingCache.end() && listingCache.size() >= LISTING_CACHE_MAX)
+		listingCache.erase(listingCache.begin());
+	listingCache[key] = { mtime, html };
 
-	return stream.str();
+	return html;
 }
 
 void	Response::locateTargetAndSetStatusCode()
@@ -504,7 +539,8 @@ void	Response::locateTargetAndSetStatusCode()
 	// Check if resource can be found and set status code
 	switch (_req.getRequestMethod()) {
 		case RequestMethod::Get:
-			if (!Pages::isCached(getAbsPath(_target)) && !resourceExists(_target, searchDir)) {
+			// A cached descriptor answers for hot files without touching the path
+			if (OpenFiles::acquire(getAbsPath(_target)) < 0 && !resourceExists(_target, searchDir)) {
 				INFO_LOG("Resource '" + _target + "' could not be found, client fd "
 					+ std::to_string(_req.getFd()));
 				_statusCode = NotFound;
@@ -636,30 +672,27 @@ static std::string const	&getResponsePageContent(std::string const &key, Config
 }
 
 /**
- * Helper function for forming directory lists, creates HTML unordered list out of a vector.
+ * Helper function for forming directory lists, appends an HTML unordered list of the
+ * directory entry names in vec to html.
  */
 static void	listify(std::vector<std::string> const &vec,
 					std::string_view listedDir,
-					std::string_view route,
-					std::stringstream &stream)
+					std::string &html)
 {
-	stream << "<ul>\n";
-	for (auto const &entryPath : vec) {
-		std::string_view	uriLastPart = entryPath;
-
-		uriLastPart = uriLastPart.substr(route.length() + 1);
-
-		stream << "<li>";
-		if (listedDir == "/")
-			stream << "<a href=\"/" << uriLastPart << "\">";
-		else {
-			if (listedDir.back() == '/')
-				listedDir = listedDir.substr(0, listedDir.length() - 1);
-			stream << "<a href=\"/" << listedDir << "/" << uriLastPart << "\">";
+	if (listedDir != "/" && listedDir.back() == '/')
+		listedDir = listedDir.substr(0, listedDir.length() - 1);
+
+	html += "<ul>\n";
+	for (auto const &name : vec) {
+		html += "<li><a href=\"/";
+		if (listedDir != "/") {
+			html += listedDir;
+			html += "/";
 		}
-		stream << uriLastPart;
-		stream << "</a>";
-		stream << "</li>\n";
+		html += name;
+		html += "\">";
+		html += name;
+		html += "</a></li>\n";
 	}
-	stream << "</ul>\n";
+	html += "</ul>\n";
 }
@@ -3,6 +3,7 @@
 #include "Request.hpp"
 #include "Response.hpp"
 #include "CgiHandler.hpp"
+#include "Pages.hpp"
 #include <iostream>
 #include <string>
 #include <sys/socket.h>
@@ -168,6 +169,7 @@ void	Server::run()
 				+ std::string(strerror(errno))));
 		}
 		handleConnections();
+		Pages::completeLoads();
 	}
 
 	if (endSignal == SIGINT) {
@@ -46,7 +46,9 @@ int	main(int argc, char *argv[])
 		debugPrintActiveServers(parser, configCount);
 
 		Pages::loadDefaults(); // Load fallback status pages to cache
+		Pages::warmUp(parser.getServerConfigs()); // Preload configured pages, if enabled
 		server.run();
+		Pages::logStats();
 	} catch (std::exception const &e) {
 		std::cerr << "Exception caught at main: " << e.what() << "\n";
 		std::cerr << "Exiting\n";